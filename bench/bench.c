@@ -0,0 +1,114 @@
+/*
+ * Shared support for the C microbenchmarks.
+ *
+ * All of the benchmarks report their results as JSON, one object per line,
+ * so that the output of several runs can be concatenated and compared by
+ * other tools.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <time.h>
+
+#include <bench/bench.h>
+#include <util/messages.h>
+
+
+/*
+ * Return the time in seconds according to a monotonic clock.
+ */
+double
+bench_now(void)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+        sysdie("cannot get the time");
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+
+/*
+ * Comparison function for sorting latencies.
+ */
+static int
+compare_double(const void *a, const void *b)
+{
+    const double *x = a;
+    const double *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+
+/*
+ * Return the given percentile of a sorted array using the nearest-rank
+ * method.
+ */
+static double
+percentile(const double *sorted, unsigned long count, unsigned long percent)
+{
+    unsigned long rank;
+
+    if (count == 0)
+        return 0;
+    rank = (percent * count + 99) / 100;
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+
+/*
+ * Print the fields common to both report formats, leaving the JSON object
+ * open.
+ */
+static void
+report_start(const char *benchmark, const char *variant, unsigned long size,
+             unsigned long iterations, double seconds)
+{
+    double per_op, rate;
+
+    per_op = (iterations > 0) ? seconds / (double) iterations : 0;
+    rate = (seconds > 0) ? (double) iterations / seconds : 0;
+    printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"size\":%lu,"
+           "\"iterations\":%lu,\"seconds\":%.6f,\"ns_per_op\":%.1f,"
+           "\"ops_per_sec\":%.1f", benchmark, variant, size, iterations,
+           seconds, per_op * 1e9, rate);
+}
+
+
+/*
+ * Report the result of a benchmark.
+ */
+void
+bench_report(const char *benchmark, const char *variant, unsigned long size,
+             unsigned long iterations, double seconds)
+{
+    report_start(benchmark, variant, size, iterations, seconds);
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+/*
+ * Report the result of a benchmark, including latency percentiles.
+ */
+void
+bench_report_latency(const char *benchmark, const char *variant,
+                     unsigned long size, double *latencies,
+                     unsigned long iterations, double seconds)
+{
+    qsort(latencies, iterations, sizeof(double), compare_double);
+    report_start(benchmark, variant, size, iterations, seconds);
+    printf(",\"p50\":%.6f,\"p99\":%.6f}\n",
+           percentile(latencies, iterations, 50),
+           percentile(latencies, iterations, 99));
+    fflush(stdout);
+}
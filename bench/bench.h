@@ -0,0 +1,47 @@
+/*
+ * Shared support for the C microbenchmarks.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+
+#include <stddef.h>
+
+BEGIN_DECLS
+
+/* Return the time in seconds according to a monotonic clock. */
+double bench_now(void);
+
+/*
+ * Report the result of a benchmark as one line of JSON on standard output.
+ * benchmark is the name of the benchmark program, variant identifies what
+ * was measured, and size is the problem size (such as the number of entries
+ * in the password file), or 0 if not applicable.  iterations operations took
+ * seconds in total.
+ */
+void bench_report(const char *benchmark, const char *variant,
+                  unsigned long size, unsigned long iterations,
+                  double seconds)
+    __attribute__((__nonnull__));
+
+/*
+ * The same, but also takes the individual latencies of each operation (which
+ * will be sorted in place) and reports the p50 and p99 latency.  Used for
+ * benchmarks where each operation is slow and the distribution matters.
+ */
+void bench_report_latency(const char *benchmark, const char *variant,
+                          unsigned long size, double *latencies,
+                          unsigned long iterations, double seconds)
+    __attribute__((__nonnull__));
+
+END_DECLS
+
+#endif /* BENCH_BENCH_H */
@@ -0,0 +1,99 @@
+/*
+ * Benchmark the util/messages dispatch to message handlers.
+ *
+ * Usage: bench/messages [<iterations>]
+ *
+ * Times calls to warn and debug with various numbers of handlers installed:
+ * no handlers (the default for debug), one or four handlers that do nothing
+ * (measuring the cost of the dispatch and formatting the message length), and
+ * the default stderr handler with standard error sent to /dev/null, and the
+ * buffered handler writing JSON lines to /dev/null.  The buffered variant
+ * measures only the time spent by the caller, not by the background thread,
+ * and drops messages if that thread falls behind.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <bench/bench.h>
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/messages-buffer.h>
+
+/* The default number of messages to send for each variant. */
+#define DEFAULT_ITERATIONS 1000000UL
+
+
+/*
+ * A message handler that does nothing.
+ */
+static void
+null_handler(size_t len UNUSED, const char *fmt UNUSED, va_list args UNUSED,
+             int err UNUSED)
+{
+}
+
+
+/*
+ * Send iterations warnings with the current handlers and report the time
+ * taken under the given variant name.
+ */
+static void
+bench_warn(const char *variant, unsigned long iterations)
+{
+    unsigned long i;
+    double start;
+
+    start = bench_now();
+    for (i = 0; i < iterations; i++)
+        warn("benchmark message %lu for %s", i, variant);
+    bench_report("messages", variant, 0, iterations, bench_now() - start);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long i, iterations = DEFAULT_ITERATIONS;
+    double start;
+    char *end;
+
+    message_program_name = "bench/messages";
+    if (argc > 1) {
+        iterations = strtoul(argv[1], &end, 10);
+        if (*end != '\0' || iterations == 0)
+            die("invalid iteration count %s", argv[1]);
+    }
+
+    /* debug has no handlers by default, so this is the fast path. */
+    start = bench_now();
+    for (i = 0; i < iterations; i++)
+        debug("benchmark message %lu", i);
+    bench_report("messages", "debug-none", 0, iterations, bench_now() - start);
+
+    /* The default stderr handler, writing to /dev/null. */
+    if (freopen("/dev/null", "w", stderr) == NULL)
+        sysdie("cannot redirect standard error to /dev/null");
+    bench_warn("warn-stderr", iterations);
+
+    /* Handlers that do nothing, to measure the dispatch itself. */
+    message_handlers_warn(0);
+    bench_warn("warn-0", iterations);
+    message_handlers_warn(1, null_handler);
+    bench_warn("warn-1", iterations);
+    message_handlers_warn(4, null_handler, null_handler, null_handler,
+                          null_handler);
+    bench_warn("warn-4", iterations);
+
+    /* The buffered handler, so that formatting is the only real work. */
+    message_buffer_open("/dev/null", 4096);
+    message_handlers_warn(1, message_log_buffer_warning);
+    bench_warn("warn-buffer", iterations);
+    message_buffer_close();
+    exit(0);
+}
@@ -0,0 +1,136 @@
+/*
+ * Benchmark passwd_change's lookup of real names in the site password file.
+ *
+ * Usage: bench/passwd [<entries> ...]
+ *
+ * For each given size (10,000, 100,000, and 1,000,000 entries by default),
+ * writes a synthetic password file to a temporary file and then times
+ * passwd_find_name for users spread evenly through the file and for a user
+ * that isn't present, which requires reading the whole file.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <bench/bench.h>
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/passwd.h>
+#include <util/xmalloc.h>
+
+/* The default sizes of the password file. */
+static const unsigned long default_sizes[] = { 10000, 100000, 1000000 };
+
+/*
+ * Scale the number of lookups so that each size reads roughly this many
+ * password file lines in total, with at least MIN_LOOKUPS lookups.
+ */
+#define TOTAL_LINES 20000000UL
+#define MIN_LOOKUPS 10UL
+
+
+/*
+ * Write a password file with the given number of entries to a new temporary
+ * file and return its name, which the caller should unlink and free.
+ */
+static char *
+make_passwd(unsigned long entries)
+{
+    char *path;
+    const char *tmpdir;
+    FILE *file;
+    unsigned long i;
+    int fd;
+
+    tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL)
+        tmpdir = "/tmp";
+    xasprintf(&path, "%s/bench-passwd.XXXXXX", tmpdir);
+    fd = mkstemp(path);
+    if (fd < 0)
+        sysdie("cannot create %s", path);
+    file = fdopen(fd, "w");
+    if (file == NULL)
+        sysdie("cannot open %s", path);
+    for (i = 0; i < entries; i++)
+        fprintf(file, "u%07lu:x:%lu:100:Bench User %lu:/home/u%07lu:"
+                "/bin/sh\n", i, i + 1000, i, i);
+    if (fclose(file) != 0)
+        sysdie("cannot write to %s", path);
+    return path;
+}
+
+
+/*
+ * Time lookups of users spread through the file and of a missing user.
+ */
+static void
+bench_size(unsigned long entries)
+{
+    char *path, *name;
+    char user[32];
+    unsigned long i, lookups;
+    double start;
+
+    path = make_passwd(entries);
+    lookups = TOTAL_LINES / entries;
+    if (lookups < MIN_LOOKUPS)
+        lookups = MIN_LOOKUPS;
+
+    /*
+     * Look up users at evenly spaced positions, so on average the lookup
+     * reads half of the file.  This also warms the page cache for the second
+     * run.
+     */
+    start = bench_now();
+    for (i = 0; i < lookups; i++) {
+        snprintf(user, sizeof(user), "u%07lu", (i * entries) / lookups);
+        name = passwd_find_name(user, path);
+        if (name == NULL)
+            die("cannot find %s in %s", user, path);
+        free(name);
+    }
+    bench_report("passwd", "hit", entries, lookups, bench_now() - start);
+
+    /* Look up a user who isn't present, which reads the whole file. */
+    start = bench_now();
+    for (i = 0; i < lookups; i++) {
+        name = passwd_find_name("missing", path);
+        if (name != NULL)
+            die("found missing user in %s", path);
+    }
+    bench_report("passwd", "miss", entries, lookups, bench_now() - start);
+
+    if (unlink(path) < 0)
+        syswarn("cannot remove %s", path);
+    free(path);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int i;
+    size_t j;
+    unsigned long entries;
+    char *end;
+
+    message_program_name = "bench/passwd";
+    if (argc > 1) {
+        for (i = 1; i < argc; i++) {
+            entries = strtoul(argv[i], &end, 10);
+            if (*end != '\0' || entries == 0)
+                die("invalid size %s", argv[i]);
+            bench_size(entries);
+        }
+    } else {
+        for (j = 0; j < ARRAY_SIZE(default_sizes); j++)
+            bench_size(default_sizes[j]);
+    }
+    exit(0);
+}
@@ -0,0 +1,100 @@
+/*
+ * Benchmark password changes with krb5_set_password_using_ccache.
+ *
+ * Usage: bench/setpass [-n <count>] <principal>
+ *
+ * Sets the password of the given principal count times (100 by default)
+ * using the credentials in the default ticket cache, exactly as ksetpass
+ * does, and reports the request rate and latency distribution.  This should
+ * be run against a test KDC such as the one set up by bench/setup, since
+ * the password of principal is changed to a random string.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <bench/bench.h>
+#include <util/messages-krb5.h>
+#include <util/messages.h>
+#include <util/xmalloc.h>
+
+/* The default number of password changes. */
+#define DEFAULT_COUNT 100UL
+
+
+int
+main(int argc, char *argv[])
+{
+    krb5_context ctx;
+    krb5_ccache ccache;
+    krb5_principal princ;
+    krb5_data result_code_string, result_string;
+    krb5_error_code ret;
+    unsigned long i, count = DEFAULT_COUNT;
+    int option, result_code;
+    double start, before, *latencies;
+    char password[64];
+    char *end;
+
+    message_program_name = "bench/setpass";
+    while ((option = getopt(argc, argv, "n:")) != EOF) {
+        switch (option) {
+        case 'n':
+            count = strtoul(optarg, &end, 10);
+            if (*end != '\0' || count == 0)
+                die("invalid count %s", optarg);
+            break;
+        default:
+            die("Usage: bench/setpass [-n <count>] <principal>");
+        }
+    }
+    if (optind != argc - 1)
+        die("Usage: bench/setpass [-n <count>] <principal>");
+
+    /* The context, ticket cache, and principal are shared by all requests. */
+    ret = krb5_init_context(&ctx);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot initialize Kerberos");
+    ret = krb5_cc_default(ctx, &ccache);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot open default ticket cache");
+    ret = krb5_parse_name(ctx, argv[optind], &princ);
+    if (ret != 0)
+        die_krb5(ctx, ret, "invalid principal name %s", argv[optind]);
+
+    latencies = xcalloc(count, sizeof(double));
+    srand((unsigned int) getpid());
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        snprintf(password, sizeof(password), "Bench-%lu-%d-%lu", i, rand(),
+                 (unsigned long) getpid());
+        before = bench_now();
+        ret = krb5_set_password_using_ccache(ctx, ccache, password, princ,
+                  &result_code, &result_code_string, &result_string);
+        latencies[i] = bench_now() - before;
+        if (ret != 0)
+            die_krb5(ctx, ret, "cannot change password for %s",
+                     argv[optind]);
+        if (result_code != 0)
+            die("password change failed: (%d) %.*s%s%.*s", result_code,
+                result_code_string.length, (char *) result_code_string.data,
+                result_string.length ? ": " : "",
+                result_string.length, (char *) result_string.data);
+        krb5_free_data_contents(ctx, &result_code_string);
+        krb5_free_data_contents(ctx, &result_string);
+    }
+    bench_report_latency("setpass", "krb5_set_password_using_ccache", 0,
+                         latencies, count, bench_now() - start);
+
+    free(latencies);
+    krb5_free_principal(ctx, princ);
+    krb5_cc_close(ctx, ccache);
+    krb5_free_context(ctx);
+    exit(0);
+}
@@ -11,6 +11,15 @@
  * the new password on standard input.  The password should not have a
  * trailing newline unless that's actually part of the password.
  *
+ * If a list of kpasswd servers is configured, tracks the latency and error
+ * rate of each in a state file and tries them in order from best to worst,
+ * rather than letting the Kerberos libraries pick whichever one they find
+ * first.  The -s option instead names a single server to use, so that a
+ * caller can keep all of its changes on one domain controller.  The
+ * libraries have no interface for choosing the server, so each attempt
+ * points KRB5_CONFIG at a temporary krb5.conf that lists only that server
+ * for the realm, followed by the normal configuration.
+ *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Based on code developed by Derrick Brashear and Ken Hornstein of Sine
  * Nomine Associates, on behalf of Stanford University.
@@ -24,8 +33,453 @@
 #include <portable/krb5.h>
 #include <portable/system.h>
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <time.h>
+
+#include <util/appconfig.h>
+#include <util/messages-buffer.h>
 #include <util/messages-krb5.h>
 #include <util/messages.h>
+#include <util/xmalloc.h>
+
+/* The krb5.conf used after the temporary one if KRB5_CONFIG isn't set. */
+#ifndef KRB5_CONFIG_DEFAULT
+# define KRB5_CONFIG_DEFAULT "/etc/krb5.conf"
+#endif
+
+/* The weight given to each new sample in the running averages. */
+#define STATE_WEIGHT 0.3
+
+/*
+ * Statistics older than this many seconds are ignored, so that a server that
+ * was slow or down is tried again eventually.
+ */
+#define STATE_EXPIRE 600
+
+/* The number of seconds of latency that a 100% error rate counts as. */
+#define ERROR_PENALTY 10.0
+
+/* The number of messages buffered for the log, if one is configured. */
+#define LOG_MESSAGES 1024
+
+/* The configuration options, with their defaults. */
+static const struct appconfig_option options[] = {
+    { "kpasswd_servers", APPCONFIG_STRING, NULL, 0 },
+    { "kpasswd_state",   APPCONFIG_STRING, NULL, 0 },
+    { "log",             APPCONFIG_STRING, NULL, 0 },
+    { NULL,              APPCONFIG_STRING, NULL, 0 }
+};
+
+/* A kpasswd server and what we know about it. */
+struct server {
+    char *name;
+    double latency;             /* Running average in seconds. */
+    double errors;              /* Running average of failures, 0 to 1. */
+    time_t updated;             /* When last used, 0 if never. */
+    double score;               /* Lower is better. */
+    size_t index;               /* Position in the configured list. */
+};
+
+/* The temporary krb5.conf currently in use, removed if we die. */
+static char *temp_config = NULL;
+
+
+/*
+ * Return the current time in seconds according to a monotonic clock.
+ */
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Split a whitespace-separated list of servers into an array, storing the
+ * number of servers in count.
+ */
+static struct server *
+parse_servers(const char *list, size_t *count)
+{
+    struct server *servers;
+    const char *p, *start;
+    size_t n = 0;
+
+    servers = xcalloc(strlen(list) / 2 + 1, sizeof(struct server));
+    for (p = list; *p != '\0'; ) {
+        while (isspace((unsigned char) *p))
+            p++;
+        start = p;
+        while (*p != '\0' && !isspace((unsigned char) *p))
+            p++;
+        if (p > start) {
+            servers[n].name = xstrndup(start, (size_t) (p - start));
+            servers[n].index = n;
+            n++;
+        }
+    }
+    *count = n;
+    return servers;
+}
+
+
+/*
+ * Load the statistics for the configured servers from the state file, if it
+ * exists.  Each line of the state file is a server name, its average
+ * latency, its average error rate, and the time it was last used.
+ */
+static void
+state_read(const char *path, struct server *servers, size_t count)
+{
+    FILE *state;
+    char name[BUFSIZ];
+    double latency, errors;
+    long updated;
+    size_t i;
+
+    state = fopen(path, "r");
+    if (state == NULL)
+        return;
+    flock(fileno(state), LOCK_SH);
+    while (fscanf(state, "%1023s %lf %lf %ld", name, &latency, &errors,
+                  &updated) == 4)
+        for (i = 0; i < count; i++)
+            if (strcmp(servers[i].name, name) == 0) {
+                servers[i].latency = latency;
+                servers[i].errors = errors;
+                servers[i].updated = (time_t) updated;
+            }
+    fclose(state);
+}
+
+
+/*
+ * Record the result of an attempt against a server in the state file,
+ * updating its running averages.  The file is rewritten in place under an
+ * exclusive lock so that concurrent runs don't lose each other's updates.
+ * Errors are only warnings, since the password change matters more.
+ */
+static void
+state_update(const char *path, struct server *server, double latency,
+             bool failed)
+{
+    FILE *state;
+    char **lines = NULL;
+    char buffer[BUFSIZ], name[BUFSIZ];
+    size_t i, nlines = 0, size = 0;
+    time_t when;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        syswarn("cannot open %s", path);
+        return;
+    }
+    state = fdopen(fd, "r+");
+    if (state == NULL) {
+        syswarn("cannot open %s", path);
+        close(fd);
+        return;
+    }
+    flock(fd, LOCK_EX);
+
+    /* Keep the lines for other servers and pick up our current values. */
+    while (fgets(buffer, sizeof(buffer), state) != NULL) {
+        if (sscanf(buffer, "%1023s", name) != 1)
+            continue;
+        if (strcmp(name, server->name) == 0) {
+            sscanf(buffer, "%*s %lf %lf", &server->latency, &server->errors);
+            continue;
+        }
+        if (nlines == size) {
+            size = (size == 0) ? 16 : size * 2;
+            lines = xrealloc(lines, size * sizeof(char *));
+        }
+        lines[nlines++] = xstrdup(buffer);
+    }
+
+    /* Update the averages, starting fresh if they're stale. */
+    when = time(NULL);
+    if (server->updated == 0 || when - server->updated > STATE_EXPIRE) {
+        server->latency = latency;
+        server->errors = failed ? 1.0 : 0.0;
+    } else {
+        server->latency += STATE_WEIGHT * (latency - server->latency);
+        server->errors += STATE_WEIGHT * ((failed ? 1.0 : 0.0)
+                                          - server->errors);
+    }
+    server->updated = when;
+
+    /* Write everything back. */
+    rewind(state);
+    if (ftruncate(fd, 0) < 0)
+        syswarn("cannot truncate %s", path);
+    for (i = 0; i < nlines; i++) {
+        fputs(lines[i], state);
+        free(lines[i]);
+    }
+    free(lines);
+    fprintf(state, "%s %.6f %.6f %ld\n", server->name, server->latency,
+            server->errors, (long) server->updated);
+    if (fclose(state) != 0)
+        syswarn("cannot write %s", path);
+}
+
+
+/*
+ * Compare two servers by score, for qsort.  Ties are broken by the order in
+ * which the servers were configured, since qsort isn't stable.
+ */
+static int
+server_compare(const void *a, const void *b)
+{
+    const struct server *first = a;
+    const struct server *second = b;
+
+    if (first->score < second->score)
+        return -1;
+    else if (first->score > second->score)
+        return 1;
+    else if (first->index < second->index)
+        return -1;
+    else if (first->index > second->index)
+        return 1;
+    else
+        return 0;
+}
+
+
+/*
+ * Sort the servers from best to worst.  The score is the average latency
+ * plus a penalty for the error rate.  Servers without recent statistics
+ * score zero so that they're tried, which is how new servers and servers
+ * that were bad a while ago get measured.  Servers with the same score,
+ * such as all of them when there are no statistics, keep the configured
+ * order.
+ */
+static void
+rank_servers(struct server *servers, size_t count)
+{
+    time_t when;
+    size_t i;
+
+    when = time(NULL);
+    for (i = 0; i < count; i++) {
+        if (servers[i].updated == 0
+            || when - servers[i].updated > STATE_EXPIRE)
+            servers[i].score = 0;
+        else
+            servers[i].score = servers[i].latency
+                + servers[i].errors * ERROR_PENALTY;
+    }
+    qsort(servers, count, sizeof(struct server), server_compare);
+}
+
+
+/*
+ * Write a temporary krb5.conf directing kpasswd requests for the realm to a
+ * particular server, and point KRB5_CONFIG at it followed by the original
+ * configuration.  The realm is marked final so that the Kerberos libraries
+ * ignore the rest of its configuration, including any other kpasswd servers,
+ * rather than quietly falling back on them.  Returns the path to the
+ * temporary file, which the caller should remove.  Until then, it's also
+ * removed by remove_temp_config if we die.
+ */
+static char *
+config_server(const char *realm, const char *server, const char *original)
+{
+    char *path, *value;
+    const char *tmpdir;
+    FILE *config;
+    int fd;
+
+    tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL)
+        tmpdir = "/tmp";
+    xasprintf(&path, "%s/ksetpass-XXXXXX", tmpdir);
+    fd = mkstemp(path);
+    if (fd < 0)
+        sysdie("cannot create temporary file %s", path);
+    temp_config = path;
+    config = fdopen(fd, "w");
+    if (config == NULL)
+        sysdie("cannot open temporary file %s", path);
+    fprintf(config, "[realms]\n    %s = {\n        kpasswd_server = %s\n"
+            "    }*\n", realm, server);
+    if (fclose(config) != 0)
+        sysdie("cannot write temporary file %s", path);
+    xasprintf(&value, "%s:%s", path, original);
+    if (setenv("KRB5_CONFIG", value, 1) != 0)
+        sysdie("cannot set KRB5_CONFIG");
+    free(value);
+    return path;
+}
+
+
+/*
+ * Remove the temporary krb5.conf, if any.  Used as the fatal cleanup
+ * function so that the file isn't left behind if setting the password dies.
+ */
+static int
+remove_temp_config(void)
+{
+    if (temp_config != NULL)
+        unlink(temp_config);
+    return 1;
+}
+
+
+/*
+ * Get a ticket for the password change service of the realm and store it in
+ * the default ticket cache.  The temporary configuration written by
+ * config_server hides the realm's KDCs, so this has to be done first, with
+ * the original configuration.  The password change then finds the ticket in
+ * the cache and only has to talk to the kpasswd server.
+ */
+static void
+get_changepw_ticket(krb5_context ctx, const char *realm)
+{
+    krb5_ccache ccache;
+    krb5_creds in, *out;
+    krb5_error_code ret;
+
+    memset(&in, 0, sizeof(in));
+    ret = krb5_cc_default(ctx, &ccache);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot open default ticket cache");
+    ret = krb5_cc_get_principal(ctx, ccache, &in.client);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot get principal from ticket cache");
+    ret = krb5_build_principal(ctx, &in.server, (unsigned int) strlen(realm),
+                               realm, "kadmin", "changepw", (char *) NULL);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot create password change principal");
+    ret = krb5_get_credentials(ctx, 0, ccache, &in, &out);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot get password change ticket");
+    krb5_free_creds(ctx, out);
+    krb5_free_cred_contents(ctx, &in);
+    krb5_cc_close(ctx, ccache);
+}
+
+
+/*
+ * Set the password with a new Kerberos context, so that the current
+ * configuration is used.  Returns the Kerberos error, if any, storing the
+ * error message in a newly allocated string in error.  If the server
+ * answered, stores the result code and message in result_code and result.
+ */
+static krb5_error_code
+set_password(const char *name, const char *password, int *result_code,
+             char **result, char **error)
+{
+    krb5_context ctx;
+    krb5_ccache ccache = NULL;
+    krb5_principal princ = NULL;
+    krb5_data code_string, string;
+    krb5_error_code ret;
+    const char *message;
+
+    *error = NULL;
+    *result = NULL;
+    ret = krb5_init_context(&ctx);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot initialize Kerberos");
+    ret = krb5_cc_default(ctx, &ccache);
+    if (ret != 0)
+        die_krb5(ctx, ret, "cannot open default ticket cache");
+    ret = krb5_parse_name(ctx, name, &princ);
+    if (ret != 0)
+        die_krb5(ctx, ret, "invalid principal name %s", name);
+    memset(&code_string, 0, sizeof(code_string));
+    memset(&string, 0, sizeof(string));
+    ret = krb5_set_password_using_ccache(ctx, ccache, password, princ,
+              result_code, &code_string, &string);
+    if (ret != 0) {
+        message = krb5_get_error_message(ctx, ret);
+        *error = xstrdup(message);
+        krb5_free_error_message(ctx, message);
+    } else if (*result_code != 0) {
+        xasprintf(result, "(%d) %.*s%s%.*s", *result_code,
+                  (int) code_string.length, (char *) code_string.data,
+                  string.length ? ": " : "",
+                  (int) string.length, (char *) string.data);
+    }
+    krb5_free_principal(ctx, princ);
+    krb5_cc_close(ctx, ccache);
+    krb5_free_context(ctx);
+    return ret;
+}
+
+
+/*
+ * Set the password by trying each configured server in turn, best first,
+ * and updating the statistics for each attempt.  A server that rejects the
+ * password has still answered, so that's final.
+ */
+static void
+set_password_servers(krb5_context ctx, const char *name, const char *password,
+                     const char *list, const char *state)
+{
+    struct server *servers;
+    size_t count, i;
+    const char *realm, *original;
+    char *default_realm = NULL;
+    char *config, *result, *error;
+    int result_code = 0;
+    krb5_error_code ret;
+    double start;
+
+    servers = parse_servers(list, &count);
+    if (count == 0)
+        die("no kpasswd servers configured");
+    if (state != NULL)
+        state_read(state, servers, count);
+    rank_servers(servers, count);
+    realm = strrchr(name, '@');
+    if (realm != NULL)
+        realm++;
+    else {
+        ret = krb5_get_default_realm(ctx, &default_realm);
+        if (ret != 0)
+            die_krb5(ctx, ret, "cannot get default realm");
+        realm = default_realm;
+    }
+    original = getenv("KRB5_CONFIG");
+    if (original == NULL)
+        original = KRB5_CONFIG_DEFAULT;
+    original = xstrdup(original);
+    get_changepw_ticket(ctx, realm);
+    message_fatal_cleanup = remove_temp_config;
+
+    for (i = 0; i < count; i++) {
+        config = config_server(realm, servers[i].name, original);
+        start = now();
+        ret = set_password(name, password, &result_code, &result, &error);
+        if (state != NULL)
+            state_update(state, &servers[i], now() - start, ret != 0);
+        unlink(config);
+        temp_config = NULL;
+        free(config);
+        if (ret == 0 && result_code == 0) {
+            notice("password for %s changed via %s", name, servers[i].name);
+            exit(0);
+        }
+        if (ret == 0)
+            die("password change failed: %s", result);
+        warn("cannot change password for %s via %s: %s", name,
+             servers[i].name, error);
+        free(error);
+    }
+    die("cannot change password for %s: all kpasswd servers failed", name);
+}
+
 
 int
 main(int argc, char *argv[])
@@ -33,14 +487,28 @@ main(int argc, char *argv[])
     krb5_context ctx;
     krb5_ccache ccache;
     krb5_principal princ;
-    int result_code;
+    struct appconfig *config;
+    const char *servers, *log;
+    const char *server = NULL;
+    int option, result_code;
     char password[BUFSIZ];
     krb5_data result_code_string, result_string;
     krb5_error_code ret;
     ssize_t size;
 
     message_program_name = "ksetpass";
-    if (argc != 2)
+    while ((option = getopt(argc, argv, "s:")) != EOF) {
+        switch (option) {
+        case 's':
+            server = optarg;
+            break;
+        default:
+            die("usage: ksetpass [-s server] principal");
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1)
         die("no principal specified");
     ret = krb5_init_context(&ctx);
     if (ret != 0)
@@ -48,9 +516,9 @@ main(int argc, char *argv[])
     ret = krb5_cc_default(ctx, &ccache);
     if (ret != 0)
         die_krb5(ctx, ret, "cannot open default ticket cache");
-    ret = krb5_parse_name(ctx, argv[1], &princ);
+    ret = krb5_parse_name(ctx, argv[0], &princ);
     if (ret != 0)
-        die_krb5(ctx, ret, "invalid principal name %s", argv[1]);
+        die_krb5(ctx, ret, "invalid principal name %s", argv[0]);
     size = read(0, password, sizeof(password));
     if (size < 0)
         sysdie("cannot read password from standard input");
@@ -59,14 +527,42 @@ main(int argc, char *argv[])
     if (size >= (ssize_t) sizeof(password))
         die("password too long");
     password[size] = '\0';
+
+    config = appconfig_load(ctx, "ksetpass", NULL, options);
+
+    /*
+     * If a log is configured, record notices there and copy warnings and
+     * errors to it.  Notices are only used for the log.
+     */
+    log = appconfig_string(config, "log");
+    if (log != NULL) {
+        message_buffer_open(strcmp(log, "syslog") == 0 ? NULL : log,
+                            LOG_MESSAGES);
+        message_handlers_notice(1, message_log_buffer_notice);
+        message_handlers_warn(2, message_log_stderr,
+                              message_log_buffer_warning);
+        message_handlers_die(2, message_log_stderr, message_log_buffer_crit);
+    } else {
+        message_handlers_notice(0);
+    }
+
+    /* If we were given a server or have a list of them, pick one ourselves. */
+    servers = appconfig_string(config, "kpasswd_servers");
+    if (server != NULL)
+        servers = server;
+    if (servers != NULL)
+        set_password_servers(ctx, argv[0], password, servers,
+                             appconfig_string(config, "kpasswd_state"));
+
     ret = krb5_set_password_using_ccache(ctx, ccache, password, princ,
               &result_code, &result_code_string, &result_string);
     if (ret != 0)
-        die_krb5(ctx, ret, "cannot change password for %s", argv[1]);
+        die_krb5(ctx, ret, "cannot change password for %s", argv[0]);
     if (result_code != 0)
         die("password change failed: (%d) %.*s%s%.*s", result_code,
             result_code_string.length, (char *) result_code_string.data,
             result_string.length ? ": " : "",
             result_string.length, (char *) result_string.data);
+    notice("password for %s changed", argv[0]);
     exit(0);
 }
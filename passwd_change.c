@@ -22,9 +22,15 @@
 #include <errno.h>
 #include <remctl.h>
 #include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
 
+#include <util/appconfig.h>
+#include <util/arena.h>
+#include <util/messages-buffer.h>
 #include <util/messages-krb5.h>
 #include <util/messages.h>
+#include <util/passwd.h>
 #include <util/xmalloc.h>
 
 /* The full path to the site-wide password file, for real name mapping. */
@@ -45,55 +51,162 @@
 # define PORT 4443
 #endif
 
+/* The configuration file, which overrides the above defaults. */
+#ifndef CONFIG_FILE
+# define CONFIG_FILE "/etc/passwd_change.conf"
+#endif
+
 /* The memory cache used for the password change authentication. */
 #define CACHE_NAME "MEMORY:passwd_change"
 
+/*
+ * The cache in which to keep the password change ticket if ticket_reuse is
+ * set.  %{uid} is replaced with the user's UID.
+ */
+#ifndef REUSE_CACHE
+# define REUSE_CACHE "FILE:/tmp/krb5cc_passwd_change_%{uid}"
+#endif
+
+/* A kept ticket must be good for this many more seconds to be reused. */
+#define REUSE_MARGIN 60
 
 /*
- * Load a string option from Kerberos appdefaults.
+ * How many times to send a password reset if the remctl connection fails.
+ * Each attempt uses the same idempotency key, so this is safe even if an
+ * earlier attempt actually reached the server.  Errors reported by the
+ * server, such as an ACL denial, are not retried.
  */
-static void
-config_string(krb5_context ctx, const char *opt, const char *defval,
-              char **result)
+#define REMCTL_TRIES 3
+
+/* The number of messages buffered for the log, if one is configured. */
+#define LOG_MESSAGES 1024
+
+
+/* The configuration options, with their compiled-in defaults. */
+static const struct appconfig_option options[] = {
+    { "log",               APPCONFIG_STRING, NULL,        0    },
+    { "passwd_file",       APPCONFIG_STRING, PASSWD_FILE, 0    },
+    { "port",              APPCONFIG_NUMBER, NULL,        PORT },
+    { "server",            APPCONFIG_STRING, HOST,        0    },
+    { "service_principal", APPCONFIG_STRING, PRINCIPAL,   0    },
+    { "ticket_cache",      APPCONFIG_STRING, REUSE_CACHE, 0    },
+    { "ticket_reuse",      APPCONFIG_NUMBER, NULL,        0    },
+    { NULL,                APPCONFIG_STRING, NULL,        0    }
+};
+
+
+/*
+ * Return the name of the cache for kept tickets, with %{uid} replaced by the
+ * current UID, as a newly allocated string.
+ */
+static char *
+reuse_cache_name(const char *template)
 {
-    krb5_appdefault_string(ctx, "passwd_change", NULL, opt, defval, result);
+    const char *uid;
+    char *name;
+
+    uid = strstr(template, "%{uid}");
+    if (uid == NULL)
+        return xstrdup(template);
+    xasprintf(&name, "%.*s%lu%s", (int) (uid - template), template,
+              (unsigned long) getuid(), uid + strlen("%{uid}"));
+    return name;
 }
 
 
 /*
- * Load a number option from Kerberos appdefaults.  The native interface
- * doesn't support numbers, so we actually read a string and then convert.
+ * Return true if a cache is safe to keep a ticket in.  For file caches, the
+ * file must either not exist yet or be a regular file that belongs to us and
+ * isn't accessible to anyone else.  Other cache types are protected by the
+ * Kerberos libraries.
  */
-static void
-config_number(krb5_context ctx, const char *opt, int defval, int *result)
+static bool
+reuse_cache_private(const char *name)
 {
-    char *tmp = NULL;
+    struct stat st;
+    const char *path = name;
+
+    if (strncmp(name, "FILE:", strlen("FILE:")) == 0)
+        path = name + strlen("FILE:");
+    else if (name[0] != '/')
+        return true;
+    if (lstat(path, &st) < 0)
+        return errno == ENOENT;
+    return S_ISREG(st.st_mode) && st.st_uid == getuid()
+        && (st.st_mode & 077) == 0;
+}
 
-    krb5_appdefault_string(ctx, "passwd_change", NULL, opt, "", &tmp);
-    if (tmp != NULL && tmp[0] != '\0')
-        *result = atoi(tmp);
-    else
-        *result = defval;
-    if (tmp != NULL)
-        free(tmp);
+
+/*
+ * Check whether the kept ticket cache holds a ticket for the password change
+ * service for the same principal that's good for at least REUSE_MARGIN more
+ * seconds.  Returns true if so.
+ */
+static bool
+reuse_ticket(krb5_context ctx, const char *cache, krb5_principal princ,
+             const char *service)
+{
+    krb5_ccache ccache;
+    krb5_principal owner = NULL;
+    krb5_cc_cursor cursor;
+    krb5_creds creds;
+    char *server;
+    size_t length;
+    time_t now;
+    bool found = false;
+
+    if (krb5_cc_resolve(ctx, cache, &ccache) != 0)
+        return false;
+    if (krb5_cc_get_principal(ctx, ccache, &owner) != 0)
+        goto done;
+    if (!krb5_principal_compare(ctx, princ, owner))
+        goto done;
+    if (krb5_cc_start_seq_get(ctx, ccache, &cursor) != 0)
+        goto done;
+    now = time(NULL);
+    length = strlen(service);
+    while (!found && krb5_cc_next_cred(ctx, ccache, &cursor, &creds) == 0) {
+        if (creds.times.endtime > now + REUSE_MARGIN
+            && krb5_unparse_name(ctx, creds.server, &server) == 0) {
+            found = (strncmp(server, service, length) == 0
+                     && (server[length] == '\0' || server[length] == '@'));
+            krb5_free_unparsed_name(ctx, server);
+        }
+        krb5_free_cred_contents(ctx, &creds);
+    }
+    krb5_cc_end_seq_get(ctx, ccache, &cursor);
+
+done:
+    if (owner != NULL)
+        krb5_free_principal(ctx, owner);
+    krb5_cc_close(ctx, ccache);
+    return found;
 }
 
 
 /*
  * Open a connection to kadmind and authenticate to the server.  This creates
  * a new ticket file and obtains the service/password-change ticket which will
- * then be used to change the user's password.  Returns 0 on success and -1 on
- * a failure it's worth retrying.  For some failures, such as memory
- * allocation problems, just dies.
+ * then be used to change the user's password.
+ *
+ * If reuse is greater than zero, the ticket is requested with that lifetime
+ * and kept in the cache named by reuse_cache rather than in memory, and a
+ * ticket kept there by an earlier run is used instead of prompting again if
+ * it is still valid.
+ *
+ * Returns 0 on success and -1 on a failure it's worth retrying.  For some
+ * failures, such as memory allocation problems, just dies.
  */
 static int
-login(krb5_context ctx, char *service)
+login(krb5_context ctx, const char *service, const char *reuse_cache,
+      long reuse)
 {
     krb5_error_code status;
     krb5_ccache ccache = NULL;
     krb5_principal princ = NULL;
     krb5_creds creds;
     krb5_get_init_creds_opt *opts;
+    char *cache;
 
     /*
      * First of all, we have to figure out what the admin principal is.  We do
@@ -112,35 +225,58 @@ login(krb5_context ctx, char *service)
     krb5_cc_close(ctx, ccache);
     ccache = NULL;
 
+    /* If we have a kept ticket that's still good, use it. */
+    if (reuse > 0) {
+        cache = reuse_cache_name(reuse_cache);
+        if (!reuse_cache_private(cache)) {
+            warn("not keeping tickets in %s, which others can access",
+                 cache);
+            free(cache);
+            reuse = 0;
+        } else if (reuse_ticket(ctx, cache, princ, service)) {
+            krb5_free_principal(ctx, princ);
+            if (setenv("KRB5CCNAME", cache, 1) != 0)
+                sysdie("setenv of KRB5CCNAME failed");
+            free(cache);
+            return 0;
+        }
+    }
+    if (reuse <= 0)
+        cache = xstrdup(CACHE_NAME);
+
     /* Now, we have the user's principal in principal.  Authenticate. */
     status = krb5_get_init_creds_opt_alloc(ctx, &opts);
     if (status != 0)
         die_krb5(ctx, status, "cannot allocate credential options");
     krb5_get_init_creds_opt_set_default_flags(ctx, "passwd_change",
                                               princ->realm, opts);
+    if (reuse > 0)
+        krb5_get_init_creds_opt_set_tkt_life(opts, (krb5_deltat) reuse);
     memset(&creds, 0, sizeof(creds));
     status = krb5_get_init_creds_password(ctx, &creds, princ, NULL,
                  krb5_prompter_posix, NULL, 0, service, opts);
     if (status != 0) {
         warn_krb5(ctx, status, "authentication failed");
+        free(cache);
         goto fail;
     }
 
-    /* Put the new credentials into a memory cache. */
-    status = krb5_cc_resolve(ctx, CACHE_NAME, &ccache);
+    /* Put the new credentials into a memory cache or the kept cache. */
+    status = krb5_cc_resolve(ctx, cache, &ccache);
     if (status != 0)
-        die_krb5(ctx, status, "cannot create memory cache");
+        die_krb5(ctx, status, "cannot create ticket cache %s", cache);
     status = krb5_cc_initialize(ctx, ccache, princ);
     if (status != 0)
-        die_krb5(ctx, status, "cannot initialize memory cache");
+        die_krb5(ctx, status, "cannot initialize ticket cache %s", cache);
     krb5_free_principal(ctx, princ);
     status = krb5_cc_store_cred(ctx, ccache, &creds);
     if (status != 0)
         die_krb5(ctx, status, "cannot store credentials");
     krb5_cc_close(ctx, ccache);
     krb5_free_cred_contents(ctx, &creds);
-    if (putenv((char *) "KRB5CCNAME=" CACHE_NAME) != 0)
-        sysdie("putenv of KRB5CCNAME failed");
+    if (setenv("KRB5CCNAME", cache, 1) != 0)
+        sysdie("setenv of KRB5CCNAME failed");
+    free(cache);
     return 0;
 
 fail:
@@ -153,51 +289,128 @@ fail:
 
 
 /*
- * Prompt for a new password and write it into the given pointer.  Returns 0
- * on success, -1 on a retriable failure, and -2 on a permanent failure.
+ * Prompt for a new password and write it into the given pointer.  The
+ * prompt buffers, and therefore the password, are allocated from the given
+ * arena, which the caller resets to wipe them.  Returns 0 on success, -1 on
+ * a retriable failure, and -2 on a permanent failure.
  */
 static int
-get_password(krb5_context ctx, char **password)
+get_password(krb5_context ctx, struct arena *arena, char **password)
 {
     krb5_prompt prompts[2];
     krb5_error_code status;
-    int ret = -2;
 
     /* Set up the prompt structure. */
     prompts[0].prompt = (char *) "New password";
     prompts[0].hidden = 1;
-    prompts[0].reply = xcalloc(1, sizeof(*prompts[0].reply));
-    prompts[0].reply->data = xmalloc(BUFSIZ);
+    prompts[0].reply = arena_calloc(arena, 1, sizeof(*prompts[0].reply));
+    prompts[0].reply->data = arena_alloc(arena, BUFSIZ);
     prompts[0].reply->length = BUFSIZ;
     prompts[1].prompt = (char *) "Re-enter new password";
     prompts[1].hidden = 1;
-    prompts[1].reply = xcalloc(1, sizeof(*prompts[0].reply));
-    prompts[1].reply->data = xmalloc(BUFSIZ);
+    prompts[1].reply = arena_calloc(arena, 1, sizeof(*prompts[0].reply));
+    prompts[1].reply->data = arena_alloc(arena, BUFSIZ);
     prompts[1].reply->length = BUFSIZ;
 
     /* Finally, we can do the actual prompt. */
     status = krb5_prompter_posix(ctx, NULL, NULL, NULL, 2, prompts);
     if (status != 0) {
         warn_krb5(ctx, status, "cannot prompt for a password");
-        goto fail;
+        return -2;
     }
     if (strcmp(prompts[0].reply->data, prompts[1].reply->data) != 0) {
         warn("passwords don't match");
-        ret = -1;
-        goto fail;
+        return -1;
     }
     *password = prompts[0].reply->data;
-    free(prompts[0].reply);
-    free(prompts[1].reply->data);
-    free(prompts[1].reply);
     return 0;
+}
 
-fail:
-    free(prompts[0].reply->data);
-    free(prompts[0].reply);
-    free(prompts[1].reply->data);
-    free(prompts[1].reply);
-    return ret;
+
+/*
+ * Generate a random idempotency key for a password reset and store it, nul-
+ * terminated, in the given buffer, which must be at least 33 bytes.  Dies on
+ * failure, since this should never fail.
+ */
+static void
+make_key(char *key)
+{
+    unsigned char data[16];
+    FILE *random;
+    size_t i;
+
+    random = fopen("/dev/urandom", "r");
+    if (random == NULL)
+        sysdie("cannot open /dev/urandom");
+    if (fread(data, sizeof(data), 1, random) != 1)
+        sysdie("cannot read from /dev/urandom");
+    fclose(random);
+    for (i = 0; i < sizeof(data); i++)
+        sprintf(key + i * 2, "%02x", data[i]);
+}
+
+
+/*
+ * Run a remctl command and return the result in the same form as remctl().
+ * We use the full API so that we can tell whether an error came from the
+ * connection, in which case retry is set to true, or from the server, which
+ * won't change if we try again.
+ */
+static struct remctl_result *
+run_remctl(const char *host, unsigned short port, const char *service,
+           const char **command, bool *retry)
+{
+    struct remctl *r;
+    struct remctl_output *output;
+    struct remctl_result *result;
+    char **buf;
+    size_t *len;
+
+    *retry = false;
+    result = xcalloc(1, sizeof(struct remctl_result));
+    r = remctl_new();
+    if (r == NULL)
+        sysdie("cannot initialize remctl");
+    if (!remctl_open(r, host, port, service) || !remctl_command(r, command)) {
+        result->error = xstrdup(remctl_error(r));
+        *retry = true;
+        remctl_close(r);
+        return result;
+    }
+    do {
+        output = remctl_output(r);
+        if (output == NULL) {
+            result->error = xstrdup(remctl_error(r));
+            *retry = true;
+            break;
+        }
+        switch (output->type) {
+        case REMCTL_OUT_OUTPUT:
+            if (output->stream == 1) {
+                buf = &result->stdout_buf;
+                len = &result->stdout_len;
+            } else {
+                buf = &result->stderr_buf;
+                len = &result->stderr_len;
+            }
+            if (output->length > 0) {
+                *buf = xrealloc(*buf, *len + output->length);
+                memcpy(*buf + *len, output->data, output->length);
+                *len += output->length;
+            }
+            break;
+        case REMCTL_OUT_STATUS:
+            result->status = output->status;
+            break;
+        case REMCTL_OUT_ERROR:
+            result->error = xstrndup(output->data, output->length);
+            break;
+        case REMCTL_OUT_DONE:
+            break;
+        }
+    } while (output->type == REMCTL_OUT_OUTPUT);
+    remctl_close(r);
+    return result;
 }
 
 
@@ -206,29 +419,45 @@ fail:
  * then call remctl to do the real work.
  */
 static int
-reset_password(krb5_context ctx, char *principal, const char *service,
-               const char *host, unsigned short port)
+reset_password(krb5_context ctx, struct arena *arena, const char *principal,
+               const char *service, const char *host, unsigned short port)
 {
     int status;
     char *password;
     struct remctl_result *result;
-    const char *command[5];
+    const char *command[6];
+    char key[33];
+    int tries;
+    bool retry;
 
-    /* Get the new password. */
+    /* Get the new password, discarding any mismatched attempts. */
     do {
-        status = get_password(ctx, &password);
+        arena_reset(arena);
+        status = get_password(ctx, arena, &password);
         printf("\n");
     } while (status == -1);
     if (status == -2)
         return -1;
 
-    /* Reset the password. */
+    /*
+     * Reset the password.  If the connection fails, retry with the same
+     * idempotency key so that the server doesn't do the reset twice.  Don't
+     * retry errors from the server.
+     */
+    make_key(key);
     command[0] = "password";
     command[1] = "reset";
     command[2] = principal;
     command[3] = password;
-    command[4] = NULL;
-    result = remctl(host, port, service, command);
+    command[4] = key;
+    command[5] = NULL;
+    for (tries = 1; tries <= REMCTL_TRIES; tries++) {
+        result = run_remctl(host, port, service, command, &retry);
+        if (!retry || tries == REMCTL_TRIES)
+            break;
+        warn("%s, retrying", result->error);
+        remctl_result_free(result);
+    }
     if (result->error != NULL) {
         warn("%s", result->error);
         remctl_result_free(result);
@@ -240,6 +469,7 @@ reset_password(krb5_context ctx, char *principal, const char *service,
             fwrite(result->stdout_buf, result->stdout_len, 1, stdout);
         if (result->status == 0 && result->stdout_len == 0) {
             printf("Password for %s successfully changed\n", principal);
+            notice("password for %s changed", principal);
             return 0;
         } else if (result->status == 2)
             return -2;
@@ -249,62 +479,16 @@ reset_password(krb5_context ctx, char *principal, const char *service,
 }
 
 
-/*
- * Given a username, find their entry in the site password file and read off
- * their real name.  This is for a double-check verification that one has
- * typed the right account name.  Returns a malloc()d string that the caller
- * is responsible for freeing.  Returns NULL on error or if the username can't
- * be found.
- */
-static char *
-find_name(char *username, const char *passwd_file)
-{
-    FILE *passwd;
-    char buffer[1024];
-    char *name, *search, *start, *end;
-    int count;
-
-    /* Build our search string, which is the username followed by a :. */
-    xasprintf(&search, "%s:", username);
-
-    /* Open the password file. */
-    passwd = fopen(passwd_file, "r");
-    if (passwd == NULL) {
-        syswarn("unable to open site password file");
-        free(search);
-        return NULL;
-    }
-
-    /*
-     * Scan through the password file looking for our search string.  If we
-     * find it, grab the fourth field of the password entry, copy it into
-     * name, and return it.  Otherwise, return NULL.
-     */
-    name = NULL;
-    do {
-        if (!fgets(buffer, sizeof(buffer), passwd))
-            break;
-        if (!strncmp(buffer, search, strlen(search))) {
-            for (start = buffer, count = 0; *start && count < 4; start++)
-                if (*start == ':')
-                    count++;
-            for (end = start + 1; *end && *end != ':'; end++)
-                ;
-            *end = '\0';
-            name = xstrdup(start);
-        }
-    } while (name == NULL);
-    free(search);
-    return name;
-}
-
-
 int
 main(int argc, char **argv)
 {
     krb5_context ctx;
-    char *passwd, *service, *host, *p;
+    struct appconfig *config;
+    struct arena *arena;
+    const char *passwd, *service, *host, *reuse_cache, *log;
+    long reuse;
     char principal[BUFSIZ], ans[BUFSIZ];
+    char *p;
     int port, status, tries;
     char *name;
 
@@ -334,14 +518,43 @@ main(int argc, char **argv)
     status = krb5_init_context(&ctx);
     if (status != 0)
         die_krb5(ctx, status, "cannot initialize Kerberos");
-    config_string(ctx, "passwd_file", PASSWD_FILE, &passwd);
-    config_string(ctx, "service_principal", PRINCIPAL, &service);
-    config_string(ctx, "server", HOST, &host);
-    config_number(ctx, "port", PORT, &port);
+    config = appconfig_load(ctx, "passwd_change", CONFIG_FILE, options);
+    passwd = appconfig_string(config, "passwd_file");
+    service = appconfig_string(config, "service_principal");
+    host = appconfig_string(config, "server");
+    port = (int) appconfig_number(config, "port");
+    reuse_cache = appconfig_string(config, "ticket_cache");
+    reuse = appconfig_number(config, "ticket_reuse");
+
+    /*
+     * If a log is configured, record notices there and copy warnings and
+     * errors to it.  Notices are only used for the log.
+     */
+    log = appconfig_string(config, "log");
+    if (log != NULL) {
+        message_buffer_open(strcmp(log, "syslog") == 0 ? NULL : log,
+                            LOG_MESSAGES);
+        message_handlers_notice(1, message_log_buffer_notice);
+        message_handlers_warn(2, message_log_stderr,
+                              message_log_buffer_warning);
+        message_handlers_die(2, message_log_stderr, message_log_buffer_crit);
+    } else {
+        message_handlers_notice(0);
+    }
+
+    /*
+     * A kept ticket is only reused if it's good for more than REUSE_MARGIN
+     * seconds, so a shorter lifetime would only mean a useless cache.
+     */
+    if (reuse > 0 && reuse <= REUSE_MARGIN) {
+        warn("ignoring ticket_reuse of %ld, which must be more than %d",
+             reuse, REUSE_MARGIN);
+        reuse = 0;
+    }
 
     /* Authenticate to kadmind. */
     printf("Authenticating to Kerberos....\n");
-    if (login(ctx, service))
+    if (login(ctx, service, reuse_cache, reuse))
         exit(1);
     printf("\n");
   
@@ -367,7 +580,7 @@ main(int argc, char **argv)
     }
 
     /* Find the real name and print it out to make sure it's right. */
-    name = find_name(principal, passwd);
+    name = passwd_find_name(principal, passwd);
     if (name == NULL) {
         printf("That username was not found in the password file."
                "  Continue? ");
@@ -385,13 +598,20 @@ main(int argc, char **argv)
         }
     }
 
-    /* Change the password.  Loop up to five times in the case of an error. */
+    /*
+     * Change the password.  Loop up to five times in the case of an error.
+     * Everything allocated for an attempt, including the password, comes
+     * from a secure arena that's wiped before the next attempt and at exit.
+     */
+    arena = arena_new(2 * BUFSIZ + 256, true);
     for (tries = 0; tries < 5; tries++) {
-        status = reset_password(ctx, principal, service, host, port);
+        status = reset_password(ctx, arena, principal, service, host, port);
+        arena_reset(arena);
         if (!status || status == -2)
             break;
         else
             printf("\n");
     }
+    arena_free(arena);
     exit(status ? 1 : 0);
 }
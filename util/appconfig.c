@@ -0,0 +1,255 @@
+/*
+ * Cached application configuration.
+ *
+ * The application declares the options it understands, and they're all
+ * resolved once at startup, from the compiled-in defaults, an optional
+ * configuration file, and krb5.conf, into an array of parsed values.
+ * Applications have only a handful of options, so lookups just search the
+ * array.
+ *
+ * The configuration file gives sites a way to set defaults without patching
+ * the source or editing krb5.conf on every client.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <ctype.h>
+#include <errno.h>
+
+#include <util/appconfig.h>
+#include <util/messages.h>
+#include <util/xmalloc.h>
+
+/* One resolved option. */
+struct appconfig_entry {
+    const char *name;
+    enum appconfig_type type;
+    char *string;
+    long number;
+};
+
+/* The resolved options, in the order the application declared them. */
+struct appconfig {
+    struct appconfig_entry *entries;
+    size_t count;
+};
+
+/* The strings accepted for boolean options, as for krb5_appdefault_boolean. */
+static const char *const yes[] = { "y", "yes", "true", "t", "1", "on", NULL };
+static const char *const no[] = {
+    "n", "no", "false", "nil", "0", "off", NULL
+};
+
+
+/*
+ * Find an option by name, returning NULL if there is no such option.
+ */
+static struct appconfig_entry *
+find(const struct appconfig *config, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < config->count; i++)
+        if (strcmp(config->entries[i].name, name) == 0)
+            return &config->entries[i];
+    return NULL;
+}
+
+
+/*
+ * Set an option from a string value, parsing it according to its type.
+ * Returns false if the value isn't valid for the type, leaving the option
+ * unchanged.
+ */
+static bool
+set_value(struct appconfig_entry *entry, const char *value)
+{
+    const char *const *p;
+    char *end;
+    long number;
+
+    switch (entry->type) {
+    case APPCONFIG_STRING:
+        free(entry->string);
+        entry->string = xstrdup(value);
+        return true;
+    case APPCONFIG_NUMBER:
+        errno = 0;
+        number = strtol(value, &end, 10);
+        if (errno != 0 || end == value || *end != '\0')
+            return false;
+        entry->number = number;
+        return true;
+    case APPCONFIG_BOOLEAN:
+        for (p = yes; *p != NULL; p++)
+            if (strcasecmp(*p, value) == 0) {
+                entry->number = 1;
+                return true;
+            }
+        for (p = no; *p != NULL; p++)
+            if (strcasecmp(*p, value) == 0) {
+                entry->number = 0;
+                return true;
+            }
+        return false;
+    }
+    return false;
+}
+
+
+/*
+ * Read the configuration file, if it exists, and override the defaults with
+ * the options set there.
+ */
+static void
+load_file(struct appconfig *config, const char *file)
+{
+    FILE *input;
+    char buffer[BUFSIZ];
+    char *line, *name, *value, *p;
+    struct appconfig_entry *entry;
+    unsigned long lineno = 0;
+
+    input = fopen(file, "r");
+    if (input == NULL) {
+        if (errno == ENOENT)
+            return;
+        sysdie("cannot open %s", file);
+    }
+    while (fgets(buffer, sizeof(buffer), input) != NULL) {
+        lineno++;
+        for (line = buffer; isspace((unsigned char) *line); line++)
+            ;
+        p = line + strlen(line);
+        while (p > line && isspace((unsigned char) p[-1]))
+            p--;
+        *p = '\0';
+        if (*line == '\0' || *line == '#')
+            continue;
+        value = strchr(line, '=');
+        if (value == NULL)
+            die("%s:%lu: missing = in line", file, lineno);
+        for (p = value; p > line && isspace((unsigned char) p[-1]); p--)
+            ;
+        *p = '\0';
+        name = line;
+        for (value++; isspace((unsigned char) *value); value++)
+            ;
+        entry = find(config, name);
+        if (entry == NULL)
+            die("%s:%lu: unknown option %s", file, lineno, name);
+        if (!set_value(entry, value))
+            die("%s:%lu: invalid value for %s: %s", file, lineno, name,
+                value);
+    }
+    if (ferror(input))
+        sysdie("cannot read %s", file);
+    fclose(input);
+}
+
+
+/*
+ * Load the configuration for an application.
+ */
+struct appconfig *
+appconfig_load(krb5_context ctx, const char *app, const char *file,
+               const struct appconfig_option *options)
+{
+    struct appconfig *config;
+    struct appconfig_entry *entry;
+    size_t count, i;
+    char *value;
+
+    /* Start with the defaults. */
+    for (count = 0; options[count].name != NULL; count++)
+        ;
+    config = xmalloc(sizeof(struct appconfig));
+    config->count = count;
+    config->entries = xcalloc(count, sizeof(struct appconfig_entry));
+    for (i = 0; i < count; i++) {
+        entry = &config->entries[i];
+        entry->name = options[i].name;
+        entry->type = options[i].type;
+        if (options[i].string != NULL)
+            entry->string = xstrdup(options[i].string);
+        entry->number = options[i].number;
+    }
+
+    /* Then the configuration file and krb5.conf. */
+    if (file != NULL)
+        load_file(config, file);
+    for (i = 0; i < count; i++) {
+        entry = &config->entries[i];
+        value = NULL;
+        krb5_appdefault_string(ctx, app, NULL, entry->name, "", &value);
+        if (value != NULL && value[0] != '\0') {
+            if (!set_value(entry, value))
+                warn("ignoring invalid value for %s in krb5.conf: %s",
+                     entry->name, value);
+        }
+        free(value);
+    }
+    return config;
+}
+
+
+/*
+ * Look up an option of a given type, dying if it doesn't exist, since that's
+ * a bug in the caller.
+ */
+static const struct appconfig_entry *
+lookup(const struct appconfig *config, const char *name,
+       enum appconfig_type type)
+{
+    const struct appconfig_entry *entry;
+
+    entry = find(config, name);
+    if (entry == NULL || entry->type != type)
+        die("internal error: unknown configuration option %s", name);
+    return entry;
+}
+
+
+const char *
+appconfig_string(const struct appconfig *config, const char *name)
+{
+    return lookup(config, name, APPCONFIG_STRING)->string;
+}
+
+
+long
+appconfig_number(const struct appconfig *config, const char *name)
+{
+    return lookup(config, name, APPCONFIG_NUMBER)->number;
+}
+
+
+bool
+appconfig_boolean(const struct appconfig *config, const char *name)
+{
+    return lookup(config, name, APPCONFIG_BOOLEAN)->number != 0;
+}
+
+
+/*
+ * Free the configuration, including all of the string values.
+ */
+void
+appconfig_free(struct appconfig *config)
+{
+    size_t i;
+
+    if (config == NULL)
+        return;
+    for (i = 0; i < config->count; i++)
+        free(config->entries[i].string);
+    free(config->entries);
+    free(config);
+}
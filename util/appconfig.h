@@ -0,0 +1,79 @@
+/*
+ * Prototypes for cached application configuration.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef UTIL_APPCONFIG_H
+#define UTIL_APPCONFIG_H 1
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/macros.h>
+#include <portable/stdbool.h>
+
+/* The types of configuration options. */
+enum appconfig_type {
+    APPCONFIG_STRING,
+    APPCONFIG_NUMBER,
+    APPCONFIG_BOOLEAN
+};
+
+/*
+ * A configuration option the application understands.  Applications pass an
+ * array of these, terminated by an entry with a NULL name, to appconfig_load.
+ * The default is taken from string for string options and from number for
+ * number and boolean options.
+ */
+struct appconfig_option {
+    const char *name;
+    enum appconfig_type type;
+    const char *string;
+    long number;
+};
+
+/* The loaded configuration is opaque to its users. */
+struct appconfig;
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Load the configuration for an application once.  Each option starts with
+ * its default, is overridden by the file, if not NULL and it exists, and then
+ * by the application's section of [appdefaults] in krb5.conf.  The file
+ * contains lines of the form "option = value", with blank lines and lines
+ * starting with # ignored.  Values are parsed according to the option type,
+ * and unknown options or invalid values in the file are fatal.
+ */
+struct appconfig *appconfig_load(krb5_context, const char *app,
+                                 const char *file,
+                                 const struct appconfig_option *)
+    __attribute__((__nonnull__(1, 2, 4)));
+
+/*
+ * Look up an option, which must be one passed to appconfig_load with the
+ * same type.  Strings are owned by the configuration and remain valid until
+ * it's freed.
+ */
+const char *appconfig_string(const struct appconfig *, const char *)
+    __attribute__((__nonnull__));
+long appconfig_number(const struct appconfig *, const char *)
+    __attribute__((__nonnull__));
+bool appconfig_boolean(const struct appconfig *, const char *)
+    __attribute__((__nonnull__));
+
+/* Free a loaded configuration. */
+void appconfig_free(struct appconfig *);
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_APPCONFIG_H */
@@ -0,0 +1,293 @@
+/*
+ * Arena memory allocation with error checking.
+ *
+ * An arena hands out memory from large chunks by advancing a pointer, and
+ * everything allocated from it is released at once with arena_reset or
+ * arena_free.  Reset keeps the chunks, so a loop that resets the arena after
+ * each record allocates from the system only while the arena grows to the
+ * size of the largest record, and never again after that.
+ *
+ * Arenas created as secure are zeroed on reset and free, in a way the
+ * compiler can't optimize away, so that they can hold passwords.
+ *
+ * As with xmalloc, allocation failures are passed to xmalloc_error_handler,
+ * and the allocation is retried if the handler returns.  The functions
+ * defined here are actually x_arena_alloc, etc., and the header defines
+ * macros that pass in the file name and line number.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <util/arena.h>
+#include <util/xmalloc.h>
+
+/* The smallest chunk allocated, unless the arena was created smaller. */
+#define ARENA_MIN_CHUNK 1024
+
+/* A type with the strictest alignment, used to align allocations. */
+union arena_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+#define ARENA_ALIGN sizeof(union arena_align)
+
+/*
+ * A chunk of memory.  The data follows the header, which is padded to keep
+ * it aligned.
+ */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    union arena_align align;
+};
+#define CHUNK_DATA(c) ((char *) (c) + sizeof(struct arena_chunk))
+
+/*
+ * The arena itself.  Chunks before current are full, and chunks after it are
+ * left over from before the last reset and are empty.
+ */
+struct arena {
+    struct arena_chunk *first;
+    struct arena_chunk *current;
+    size_t chunk_size;
+    bool secure;
+};
+
+
+/*
+ * Zero memory in a way that won't be optimized away even though the memory
+ * isn't read afterwards.
+ */
+static void
+arena_zero(void *data, size_t length)
+{
+#ifdef HAVE_EXPLICIT_BZERO
+    explicit_bzero(data, length);
+#else
+    volatile unsigned char *p = data;
+
+    while (length-- > 0)
+        *p++ = 0;
+#endif
+}
+
+
+/*
+ * Allocate a new chunk large enough for at least size bytes.  Chunk sizes
+ * are a multiple of the alignment so that the free space at the end of a
+ * chunk is always usable.
+ */
+static struct arena_chunk *
+arena_chunk_new(struct arena *arena, size_t size, const char *file, int line)
+{
+    struct arena_chunk *chunk;
+
+    if (size < arena->chunk_size)
+        size = arena->chunk_size;
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    chunk = x_malloc(sizeof(struct arena_chunk) + size, file, line);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+
+/*
+ * Create a new arena whose chunks hold size bytes (or the minimum chunk size,
+ * if larger).  The first chunk is allocated immediately.
+ */
+struct arena *
+x_arena_new(size_t size, bool secure, const char *file, int line)
+{
+    struct arena *arena;
+
+    arena = x_malloc(sizeof(struct arena), file, line);
+    arena->chunk_size = (size < ARENA_MIN_CHUNK) ? ARENA_MIN_CHUNK : size;
+    arena->secure = secure;
+    arena->first = arena_chunk_new(arena, 0, file, line);
+    arena->current = arena->first;
+    return arena;
+}
+
+
+/*
+ * Allocate size bytes from an arena.  Uses the first chunk from the current
+ * one onwards that has room, adding a new chunk at the end if none do.
+ */
+void *
+x_arena_alloc(struct arena *arena, size_t size, const char *file, int line)
+{
+    struct arena_chunk *chunk, *last;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (size == 0)
+        size = ARENA_ALIGN;
+    last = arena->current;
+    for (chunk = arena->current; chunk != NULL; chunk = chunk->next) {
+        if (chunk->size - chunk->used >= size)
+            break;
+        last = chunk;
+    }
+    if (chunk == NULL) {
+        chunk = arena_chunk_new(arena, size, file, line);
+        last->next = chunk;
+    }
+    arena->current = chunk;
+    p = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+
+/*
+ * Allocate zeroed memory for n objects of the given size from an arena,
+ * checking for overflow.
+ */
+void *
+x_arena_calloc(struct arena *arena, size_t n, size_t size, const char *file,
+               int line)
+{
+    void *p;
+
+    if (size != 0 && n > (size_t) -1 / size) {
+        (*xmalloc_error_handler)("arena_calloc", 0, file, line);
+        n = 0;
+    }
+    p = x_arena_alloc(arena, n * size, file, line);
+    memset(p, 0, n * size);
+    return p;
+}
+
+
+/*
+ * Copy a string into an arena.
+ */
+char *
+x_arena_strdup(struct arena *arena, const char *s, const char *file,
+               int line)
+{
+    size_t length;
+    char *p;
+
+    length = strlen(s) + 1;
+    p = x_arena_alloc(arena, length, file, line);
+    memcpy(p, s, length);
+    return p;
+}
+
+
+/*
+ * Format a string into an arena, returning it.  Try formatting directly into
+ * the free space of the current chunk first, and only if it doesn't fit, use
+ * the length that vsnprintf returned to allocate space and format it again.
+ */
+char *
+x_arena_vasprintf(struct arena *arena, const char *fmt, va_list args,
+                  const char *file, int line)
+{
+    struct arena_chunk *chunk = arena->current;
+    va_list args_copy;
+    size_t avail;
+    int length;
+    char *p;
+
+    avail = chunk->size - chunk->used;
+    p = CHUNK_DATA(chunk) + chunk->used;
+    va_copy(args_copy, args);
+    length = vsnprintf(p, avail, fmt, args_copy);
+    va_end(args_copy);
+    while (length < 0) {
+        (*xmalloc_error_handler)("arena_vasprintf", 0, file, line);
+        va_copy(args_copy, args);
+        length = vsnprintf(p, avail, fmt, args_copy);
+        va_end(args_copy);
+    }
+    if ((size_t) length < avail)
+        return x_arena_alloc(arena, (size_t) length + 1, file, line);
+    if (arena->secure)
+        arena_zero(p, avail);
+    p = x_arena_alloc(arena, (size_t) length + 1, file, line);
+    va_copy(args_copy, args);
+    vsnprintf(p, (size_t) length + 1, fmt, args_copy);
+    va_end(args_copy);
+    return p;
+}
+
+
+#if HAVE_C99_VAMACROS || HAVE_GNU_VAMACROS
+char *
+x_arena_asprintf(struct arena *arena, const char *file, int line,
+                 const char *fmt, ...)
+{
+    va_list args;
+    char *p;
+
+    va_start(args, fmt);
+    p = x_arena_vasprintf(arena, fmt, args, file, line);
+    va_end(args);
+    return p;
+}
+#else /* !(HAVE_C99_VAMACROS || HAVE_GNU_VAMACROS) */
+char *
+x_arena_asprintf(struct arena *arena, const char *fmt, ...)
+{
+    va_list args;
+    char *p;
+
+    va_start(args, fmt);
+    p = x_arena_vasprintf(arena, fmt, args, __FILE__, __LINE__);
+    va_end(args);
+    return p;
+}
+#endif /* !(HAVE_C99_VAMACROS || HAVE_GNU_VAMACROS) */
+
+
+/*
+ * Reset an arena, keeping its chunks for reuse.  Only the chunks up to the
+ * current one can have anything in them.
+ */
+void
+arena_reset(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+
+    for (chunk = arena->first; chunk != NULL; chunk = chunk->next) {
+        if (arena->secure)
+            arena_zero(CHUNK_DATA(chunk), chunk->used);
+        chunk->used = 0;
+        if (chunk == arena->current)
+            break;
+    }
+    arena->current = arena->first;
+}
+
+
+/*
+ * Free an arena and all of its chunks.
+ */
+void
+arena_free(struct arena *arena)
+{
+    struct arena_chunk *chunk, *next;
+
+    if (arena == NULL)
+        return;
+    arena_reset(arena);
+    for (chunk = arena->first; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(arena);
+}
@@ -0,0 +1,96 @@
+/*
+ * Prototypes for arena memory allocation with error checking.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef UTIL_ARENA_H
+#define UTIL_ARENA_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+#include <portable/stdbool.h>
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/* An arena is opaque to its users. */
+struct arena;
+
+/*
+ * As with xmalloc, the functions are actually macros so that we can pick up
+ * the file and line number information for error messages.
+ */
+#define arena_new(size, secure) \
+    x_arena_new((size), (secure), __FILE__, __LINE__)
+#define arena_alloc(a, size) \
+    x_arena_alloc((a), (size), __FILE__, __LINE__)
+#define arena_calloc(a, n, size) \
+    x_arena_calloc((a), (n), (size), __FILE__, __LINE__)
+#define arena_strdup(a, p) \
+    x_arena_strdup((a), (p), __FILE__, __LINE__)
+#define arena_vasprintf(a, f, args) \
+    x_arena_vasprintf((a), (f), (args), __FILE__, __LINE__)
+
+/* The same variadic macro handling as xasprintf. */
+#ifdef HAVE_C99_VAMACROS
+# define arena_asprintf(a, f, ...) \
+    x_arena_asprintf((a), __FILE__, __LINE__, (f), __VA_ARGS__)
+#elif HAVE_GNU_VAMACROS
+# define arena_asprintf(a, f, args...) \
+    x_arena_asprintf((a), __FILE__, __LINE__, (f), args)
+#else
+# define arena_asprintf x_arena_asprintf
+#endif
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Reset an arena, making all of its memory available again without returning
+ * it to the system.  Everything allocated from the arena since it was created
+ * or last reset becomes invalid.  If the arena was created as secure, the
+ * memory is zeroed first.
+ */
+void arena_reset(struct arena *)
+    __attribute__((__nonnull__));
+
+/* Free an arena and everything allocated from it, zeroing it if secure. */
+void arena_free(struct arena *);
+
+/*
+ * Last two arguments are always file and line number.  These are internal
+ * implementations that should not be called directly.
+ */
+struct arena *x_arena_new(size_t, bool, const char *, int)
+    __attribute__((__malloc__, __nonnull__));
+void *x_arena_alloc(struct arena *, size_t, const char *, int)
+    __attribute__((__alloc_size__(2), __malloc__, __nonnull__));
+void *x_arena_calloc(struct arena *, size_t, size_t, const char *, int)
+    __attribute__((__alloc_size__(2, 3), __malloc__, __nonnull__));
+char *x_arena_strdup(struct arena *, const char *, const char *, int)
+    __attribute__((__malloc__, __nonnull__));
+char *x_arena_vasprintf(struct arena *, const char *, va_list, const char *,
+                        int)
+    __attribute__((__malloc__, __nonnull__));
+
+/* asprintf special case. */
+#if HAVE_C99_VAMACROS || HAVE_GNU_VAMACROS
+char *x_arena_asprintf(struct arena *, const char *, int, const char *, ...)
+    __attribute__((__malloc__, __nonnull__, __format__(printf, 4, 5)));
+#else
+char *x_arena_asprintf(struct arena *, const char *, ...)
+    __attribute__((__malloc__, __nonnull__, __format__(printf, 2, 3)));
+#endif
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_ARENA_H */
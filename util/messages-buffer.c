@@ -0,0 +1,389 @@
+/*
+ * Buffered, asynchronous message logging.
+ *
+ * The message_log_syslog_* handlers make a blocking syslog call for every
+ * message, which is fine for a program that logs a few messages but means
+ * that a batch tool processing thousands of users runs only as fast as
+ * syslogd.  These handlers instead format each message into the next slot of
+ * a ring buffer allocated up front and return immediately.  A background
+ * thread wakes when the buffer is half full, or once a second, and writes
+ * everything pending in one batch, either to syslog or as JSON lines to a
+ * file.  The caller never waits on the output; if the buffer fills, new
+ * messages are dropped and counted instead.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <time.h>
+
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/messages-buffer.h>
+#include <util/xmalloc.h>
+
+/* The longest message stored, including any errno string.  Longer are cut. */
+#define MESSAGE_SLOT_SIZE 512
+
+/* The longest program name included in JSON output.  Longer are cut. */
+#define MESSAGE_NAME_SIZE 100
+
+/* The size of the output buffer for JSON lines, flushed when nearly full. */
+#define MESSAGE_JSON_SIZE (64 * 1024)
+
+/* One formatted message. */
+struct message_slot {
+    int priority;
+    struct timespec when;
+    char text[MESSAGE_SLOT_SIZE];
+};
+
+/*
+ * The state of the buffer.  produced and consumed count messages and only
+ * ever increase, so the slot for message n is n % count and the buffer is
+ * full when produced - consumed == count.  Slots between consumed and
+ * produced belong to the flusher, which only takes the lock to find out what
+ * to write and to mark it written, never while writing.
+ */
+static struct {
+    pthread_t thread;
+    struct message_slot *slots;
+    size_t count;
+    unsigned long produced;
+    unsigned long consumed;
+    unsigned long dropped;
+    bool open;
+    bool flushing;
+    bool stopping;
+    int fd;
+    char *json;
+} buffer;
+
+/*
+ * The lock protecting the counters, signalled to wake the flusher, and
+ * signalled by the flusher when messages have been written.
+ */
+static pthread_mutex_t buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buffer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t buffer_written = PTHREAD_COND_INITIALIZER;
+
+/* The names of the syslog priorities used in JSON output. */
+static const char *const priority_names[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+
+/*
+ * Write all of a buffer to the log file, ignoring errors since there's
+ * nowhere to report them.
+ */
+static void
+write_all(const char *data, size_t length)
+{
+    ssize_t status;
+
+    while (length > 0) {
+        status = write(buffer.fd, data, length);
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0)
+            return;
+        data += status;
+        length -= (size_t) status;
+    }
+}
+
+
+/*
+ * Copy at most max bytes of a string into out as the contents of a JSON
+ * string, escaping quotes, backslashes, and control characters.  out must
+ * have room for six bytes per input byte.  Returns a pointer to the end of
+ * the output.
+ */
+static char *
+json_escape(char *out, const char *text, size_t max)
+{
+    const unsigned char *p;
+
+    p = (const unsigned char *) text;
+    for (; *p != '\0' && max > 0; p++, max--) {
+        if (*p == '"' || *p == '\\') {
+            *out++ = '\\';
+            *out++ = (char) *p;
+        } else if (*p < 0x20 || *p == 0x7f) {
+            snprintf(out, 7, "\\u%04x", *p);
+            out += 6;
+        } else {
+            *out++ = (char) *p;
+        }
+    }
+    return out;
+}
+
+
+/*
+ * Append one message as a line of JSON to the output buffer, writing the
+ * buffer out first if the message might not fit.  Returns the new length of
+ * the output buffer.
+ */
+static size_t
+json_append(size_t used, const struct message_slot *slot)
+{
+    char *out;
+    int length;
+
+    /* Every character might need six bytes, plus the fixed fields. */
+    if (used + (MESSAGE_SLOT_SIZE + MESSAGE_NAME_SIZE) * 6 + 128
+        > MESSAGE_JSON_SIZE) {
+        write_all(buffer.json, used);
+        used = 0;
+    }
+    length = snprintf(buffer.json + used, MESSAGE_JSON_SIZE - used,
+                      "{\"time\":%ld.%06ld,\"priority\":\"%s\"",
+                      (long) slot->when.tv_sec, slot->when.tv_nsec / 1000,
+                      priority_names[slot->priority & LOG_PRIMASK]);
+    if (length < 0)
+        return used;
+    out = buffer.json + used + length;
+    if (message_program_name != NULL) {
+        memcpy(out, ",\"program\":\"", 12);
+        out = json_escape(out + 12, message_program_name, MESSAGE_NAME_SIZE);
+        *out++ = '"';
+    }
+    memcpy(out, ",\"message\":\"", 12);
+    out = json_escape(out + 12, slot->text, MESSAGE_SLOT_SIZE);
+    memcpy(out, "\"}\n", 3);
+    out += 3;
+    return (size_t) (out - buffer.json);
+}
+
+
+/*
+ * Write the messages numbered start up to end, plus a note about any dropped
+ * messages, to the log.  Called without the lock held.
+ */
+static void
+write_messages(unsigned long start, unsigned long end, unsigned long dropped)
+{
+    struct message_slot *slot, note;
+    unsigned long n;
+    size_t used = 0;
+
+    for (n = start; n < end; n++) {
+        slot = &buffer.slots[n % buffer.count];
+        if (buffer.fd < 0)
+            syslog(slot->priority, "%s", slot->text);
+        else
+            used = json_append(used, slot);
+    }
+    if (dropped > 0) {
+        note.priority = LOG_WARNING;
+        clock_gettime(CLOCK_REALTIME, &note.when);
+        snprintf(note.text, sizeof(note.text),
+                 "log buffer full, dropped %lu messages", dropped);
+        if (buffer.fd < 0)
+            syslog(note.priority, "%s", note.text);
+        else
+            used = json_append(used, &note);
+    }
+    if (used > 0)
+        write_all(buffer.json, used);
+}
+
+
+/*
+ * The background thread.  Waits for the buffer to be half full, for a
+ * second to pass, or to be asked to flush or stop, and then writes out
+ * everything pending.
+ */
+static void *
+flusher(void *data UNUSED)
+{
+    struct timespec deadline;
+    unsigned long start, end, dropped;
+    int status;
+
+    pthread_mutex_lock(&buffer_lock);
+    while (true) {
+        if (!buffer.stopping && !buffer.flushing
+            && buffer.produced - buffer.consumed < buffer.count / 2) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec++;
+            status = pthread_cond_timedwait(&buffer_wake, &buffer_lock,
+                                            &deadline);
+            if (status != ETIMEDOUT)
+                continue;
+        }
+        buffer.flushing = false;
+        if (buffer.produced == buffer.consumed && buffer.dropped == 0) {
+            if (buffer.stopping)
+                break;
+            continue;
+        }
+        start = buffer.consumed;
+        end = buffer.produced;
+        dropped = buffer.dropped;
+        buffer.dropped = 0;
+        pthread_mutex_unlock(&buffer_lock);
+        write_messages(start, end, dropped);
+        pthread_mutex_lock(&buffer_lock);
+        buffer.consumed = end;
+        pthread_cond_broadcast(&buffer_written);
+    }
+    pthread_mutex_unlock(&buffer_lock);
+    return NULL;
+}
+
+
+/*
+ * Start buffered logging to syslog (if path is NULL) or to a file of JSON
+ * lines, with room for count messages.
+ */
+void
+message_buffer_open(const char *path, size_t count)
+{
+    static bool registered = false;
+    int status;
+
+    if (buffer.open)
+        message_buffer_close();
+    if (count < 2)
+        count = 2;
+    buffer.fd = -1;
+    if (path != NULL) {
+        buffer.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (buffer.fd < 0)
+            sysdie("cannot open %s", path);
+        buffer.json = xmalloc(MESSAGE_JSON_SIZE);
+    }
+    buffer.slots = xcalloc(count, sizeof(struct message_slot));
+    buffer.count = count;
+    buffer.produced = 0;
+    buffer.consumed = 0;
+    buffer.dropped = 0;
+    buffer.flushing = false;
+    buffer.stopping = false;
+    status = pthread_create(&buffer.thread, NULL, flusher, NULL);
+    if (status != 0) {
+        errno = status;
+        sysdie("cannot create log flushing thread");
+    }
+    buffer.open = true;
+    if (!registered) {
+        atexit(message_buffer_close);
+        registered = true;
+    }
+}
+
+
+/*
+ * Wait until everything logged so far has been written.
+ */
+void
+message_buffer_flush(void)
+{
+    unsigned long end;
+
+    if (!buffer.open)
+        return;
+    pthread_mutex_lock(&buffer_lock);
+    end = buffer.produced;
+    buffer.flushing = true;
+    pthread_cond_signal(&buffer_wake);
+    while (buffer.consumed < end)
+        pthread_cond_wait(&buffer_written, &buffer_lock);
+    pthread_mutex_unlock(&buffer_lock);
+}
+
+
+/*
+ * Flush everything, stop the thread, and free the buffer.
+ */
+void
+message_buffer_close(void)
+{
+    if (!buffer.open)
+        return;
+    pthread_mutex_lock(&buffer_lock);
+    buffer.stopping = true;
+    pthread_cond_signal(&buffer_wake);
+    pthread_mutex_unlock(&buffer_lock);
+    pthread_join(buffer.thread, NULL);
+    buffer.open = false;
+    if (buffer.fd >= 0)
+        close(buffer.fd);
+    free(buffer.slots);
+    free(buffer.json);
+    buffer.slots = NULL;
+    buffer.json = NULL;
+}
+
+
+/*
+ * Add a message to the buffer.  This is a helper function used to implement
+ * all of the buffer message log handlers.  It takes the same arguments as a
+ * regular message handler function but with an additional priority argument.
+ * Fatal messages are written before returning, since the program is about to
+ * exit, and room is made for them rather than dropping them.
+ */
+static void
+message_log_buffer(int pri, size_t len, const char *fmt, va_list args,
+                   int err)
+{
+    struct message_slot *slot;
+    int length;
+
+    if (!buffer.open) {
+        message_log_stderr(len, fmt, args, err);
+        return;
+    }
+    if (pri <= LOG_CRIT)
+        message_buffer_flush();
+    pthread_mutex_lock(&buffer_lock);
+    if (buffer.produced - buffer.consumed >= buffer.count) {
+        buffer.dropped++;
+        pthread_mutex_unlock(&buffer_lock);
+        return;
+    }
+    slot = &buffer.slots[buffer.produced % buffer.count];
+    slot->priority = pri;
+    clock_gettime(CLOCK_REALTIME, &slot->when);
+    length = vsnprintf(slot->text, sizeof(slot->text), fmt, args);
+    if (length < 0)
+        slot->text[0] = '\0';
+    else if (err != 0 && (size_t) length < sizeof(slot->text))
+        snprintf(slot->text + length, sizeof(slot->text) - length, ": %s",
+                 strerror(err));
+    buffer.produced++;
+    if (buffer.produced - buffer.consumed == buffer.count / 2)
+        pthread_cond_signal(&buffer_wake);
+    pthread_mutex_unlock(&buffer_lock);
+    if (pri <= LOG_CRIT)
+        message_buffer_flush();
+}
+
+
+/*
+ * Generate the separate handlers for each priority, as for syslog.
+ */
+#define BUFFER_FUNCTION(name, type)                                        \
+    void                                                                   \
+    message_log_buffer_ ## name(size_t l, const char *f, va_list a, int e) \
+    {                                                                      \
+        message_log_buffer(LOG_ ## type, l, f, a, e);                      \
+    }
+BUFFER_FUNCTION(debug,   DEBUG)
+BUFFER_FUNCTION(info,    INFO)
+BUFFER_FUNCTION(notice,  NOTICE)
+BUFFER_FUNCTION(warning, WARNING)
+BUFFER_FUNCTION(err,     ERR)
+BUFFER_FUNCTION(crit,    CRIT)
@@ -0,0 +1,65 @@
+/*
+ * Prototypes for buffered, asynchronous message logging.
+ *
+ * Written by agent <agent@local>
+ * Copyright 2026 agent <agent@local>
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef UTIL_MESSAGES_BUFFER_H
+#define UTIL_MESSAGES_BUFFER_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+
+#include <stdarg.h>
+#include <stddef.h>
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Start buffered logging.  Messages passed to the message_log_buffer_*
+ * handlers are formatted into a preallocated ring buffer of count messages
+ * and written in batches by a background thread, so a slow syslogd or disk
+ * never stalls the caller.  If path is NULL, messages are sent to syslog;
+ * otherwise, they're appended to that file as JSON lines.  If the buffer is
+ * full, messages are dropped and the number dropped is logged later.
+ * Messages at LOG_CRIT or above, such as those from die, are instead always
+ * written before the handler returns.  Dies on failure.  The buffer is
+ * flushed and closed automatically at exit.
+ */
+void message_buffer_open(const char *path, size_t count);
+
+/* Wait until all messages logged so far have been written. */
+void message_buffer_flush(void);
+
+/* Flush the buffer, stop the background thread, and close the log. */
+void message_buffer_close(void);
+
+/*
+ * Handlers for message_handlers_*, one for each syslog priority.  If the
+ * buffer isn't open, these log to standard error instead.
+ */
+void message_log_buffer_debug(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_buffer_info(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_buffer_notice(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_buffer_warning(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_buffer_err(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_buffer_crit(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_MESSAGES_BUFFER_H */
@@ -0,0 +1,73 @@
+/*
+ * Look up users in the site password file.
+ *
+ * passwd_change shows the real name of the user whose password is being
+ * changed so that one can double-check that one typed the right account name.
+ * This is the lookup of that name in a site password file, split out of
+ * passwd_change so that it can be benchmarked separately.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 agent <agent@local>
+ * Copyright 1997, 2007, 2010, 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <util/messages.h>
+#include <util/passwd.h>
+#include <util/xmalloc.h>
+
+
+/*
+ * Given a username, find their entry in the site password file and read off
+ * their real name.  Returns a malloc()d string that the caller is responsible
+ * for freeing.  Returns NULL on error or if the username can't be found.
+ */
+char *
+passwd_find_name(const char *username, const char *passwd_file)
+{
+    FILE *passwd;
+    char buffer[1024];
+    char *name, *search, *start, *end;
+    size_t length;
+    int count;
+
+    /* Build our search string, which is the username followed by a :. */
+    xasprintf(&search, "%s:", username);
+    length = strlen(search);
+
+    /* Open the password file. */
+    passwd = fopen(passwd_file, "r");
+    if (passwd == NULL) {
+        syswarn("unable to open site password file");
+        free(search);
+        return NULL;
+    }
+
+    /*
+     * Scan through the password file looking for our search string.  If we
+     * find it, grab the fifth field of the password entry, copy it into
+     * name, and return it.  Otherwise, return NULL.
+     */
+    name = NULL;
+    do {
+        if (!fgets(buffer, sizeof(buffer), passwd))
+            break;
+        if (!strncmp(buffer, search, length)) {
+            for (start = buffer, count = 0; *start && count < 4; start++)
+                if (*start == ':')
+                    count++;
+            for (end = start + 1; *end && *end != ':'; end++)
+                ;
+            *end = '\0';
+            name = xstrdup(start);
+        }
+    } while (name == NULL);
+    fclose(passwd);
+    free(search);
+    return name;
+}
@@ -0,0 +1,37 @@
+/*
+ * Prototypes for looking up users in the site password file.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 agent <agent@local>
+ * Copyright 1997, 2007, 2010, 2014
+ *     The Board of Trustees of the Leland Stanford Junior University
+ *
+ * See LICENSE for licensing terms.
+ */
+
+#ifndef UTIL_PASSWD_H
+#define UTIL_PASSWD_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Given a username, find their entry in the given password file and return
+ * the real name (the GECOS field) as a newly allocated string that the caller
+ * is responsible for freeing.  Returns NULL if the file could not be opened
+ * (after reporting a warning) or if the username was not found.
+ */
+char *passwd_find_name(const char *username, const char *passwd_file)
+    __attribute__((__nonnull__, __malloc__));
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_PASSWD_H */